@@ -60,6 +60,13 @@
 
 #define DGNSS_RANGE_UPDATE_TIME_10MIN_IN_MILLI  600000
 
+// LocMsg coalesce kinds for reports that carry a full snapshot, so
+// a newer pending one makes the older ones redundant
+enum GnssAdapterCoalesceKind {
+    GNSS_ADAPTER_COALESCE_SV_REPORT = 1,
+    GNSS_ADAPTER_COALESCE_DATA_REPORT,
+};
+
 using namespace loc_core;
 
 static int loadEngHubForExternalEngine = 0;
@@ -4115,7 +4122,8 @@ GnssAdapter::reportSvEvent(const GnssSvNotification& svNotify,
         }
     };
 
-    sendMsg(new MsgReportSv(*this, svNotify));
+    sendMsg(new MsgReportSv(*this, svNotify),
+            LocMsgCoalesceKey(this, GNSS_ADAPTER_COALESCE_SV_REPORT));
 }
 
 void
@@ -4376,7 +4384,8 @@ GnssAdapter::reportDataEvent(const GnssDataNotification& dataNotify,
         }
     };
 
-    sendMsg(new MsgReportData(*this, dataNotify, msInWeek));
+    sendMsg(new MsgReportData(*this, dataNotify, msInWeek),
+            LocMsgCoalesceKey(this, GNSS_ADAPTER_COALESCE_DATA_REPORT));
 }
 
 void
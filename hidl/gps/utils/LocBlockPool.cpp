@@ -0,0 +1,106 @@
+/* Copyright (c) 2021 The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation, nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#define LOG_NDEBUG 0
+#define LOG_TAG "LocSvc_BlockPool"
+
+#include <stdlib.h>
+#include <LocBlockPool.h>
+#include <log_util.h>
+
+namespace loc_util {
+
+LocBlockPool::LocBlockPool(size_t blockSize, size_t blocksPerSlab) :
+        // room for the header, and keep every block max_align_t aligned
+        mBlockSize((blockSize + sizeof(BlockHeader) + sizeof(BlockHeader) - 1) /
+                   sizeof(BlockHeader) * sizeof(BlockHeader)),
+        mBlocksPerSlab(blocksPerSlab > 0 ? blocksPerSlab : 1),
+        mFreeList(nullptr), mHeapAllocCount(0) {
+}
+
+LocBlockPool::~LocBlockPool() {
+    for (auto slab : mSlabs) {
+        free(slab);
+    }
+}
+
+// must be called with mMutex held
+bool LocBlockPool::grow() {
+    char* slab = (char*)malloc(mBlockSize * mBlocksPerSlab);
+    if (nullptr == slab) {
+        LOC_LOGE("%s: failed to allocate slab of %zu blocks", __func__, mBlocksPerSlab);
+        return false;
+    }
+    mHeapAllocCount.fetch_add(1, std::memory_order_relaxed);
+    mSlabs.push_back(slab);
+    for (size_t i = 0; i < mBlocksPerSlab; i++) {
+        FreeBlock* block = (FreeBlock*)(slab + i * mBlockSize);
+        block->mNext = mFreeList;
+        mFreeList = block;
+    }
+    return true;
+}
+
+void* LocBlockPool::alloc(size_t size) {
+    BlockHeader* header = nullptr;
+    if (size + sizeof(BlockHeader) > mBlockSize) {
+        header = (BlockHeader*)malloc(size + sizeof(BlockHeader));
+        if (nullptr == header) {
+            return nullptr;
+        }
+        mHeapAllocCount.fetch_add(1, std::memory_order_relaxed);
+        header->mPool = nullptr;
+    } else {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (nullptr == mFreeList && !grow()) {
+            return nullptr;
+        }
+        header = (BlockHeader*)mFreeList;
+        mFreeList = mFreeList->mNext;
+        header->mPool = this;
+    }
+    return header + 1;
+}
+
+void LocBlockPool::release(void* block) {
+    if (nullptr == block) {
+        return;
+    }
+    BlockHeader* header = (BlockHeader*)block - 1;
+    LocBlockPool* pool = header->mPool;
+    if (nullptr == pool) {
+        free(header);
+    } else {
+        std::lock_guard<std::mutex> lock(pool->mMutex);
+        FreeBlock* freeBlock = (FreeBlock*)header;
+        freeBlock->mNext = pool->mFreeList;
+        pool->mFreeList = freeBlock;
+    }
+}
+
+} // namespace loc_util
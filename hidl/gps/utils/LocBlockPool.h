@@ -0,0 +1,89 @@
+/* Copyright (c) 2021 The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation, nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef __LOC_BLOCK_POOL_H__
+#define __LOC_BLOCK_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+#include <atomic>
+#include <vector>
+
+namespace loc_util {
+
+// A thread safe pool of fixed size memory blocks, meant to back the operator
+// new / delete of message objects that are created on one thread and freed on
+// another. Blocks are carved out of slabs which are only given back when the
+// pool itself goes away, so once the pool has grown to the working set,
+// alloc() and release() never touch the heap.
+//
+// Every block is prefixed with a header pointing back to its pool, so that
+// release() only needs the block address. Requests bigger than the block size
+// fall back to the heap and are counted in getHeapAllocCount().
+// The pool must outlive every block allocated from it.
+class LocBlockPool {
+    union BlockHeader {
+        LocBlockPool* mPool;
+        max_align_t mAlign;
+    };
+    struct FreeBlock {
+        FreeBlock* mNext;
+    };
+
+    const size_t mBlockSize;
+    const size_t mBlocksPerSlab;
+    std::mutex mMutex;
+    FreeBlock* mFreeList;
+    std::vector<void*> mSlabs;
+    std::atomic<uint64_t> mHeapAllocCount;
+
+    bool grow();
+
+public:
+    LocBlockPool(size_t blockSize, size_t blocksPerSlab);
+    ~LocBlockPool();
+
+    LocBlockPool(const LocBlockPool&) = delete;
+    LocBlockPool& operator=(const LocBlockPool&) = delete;
+
+    // returns nullptr only if the heap is exhausted
+    void* alloc(size_t size);
+    // returns a block from alloc() of whichever pool it came from
+    static void release(void* block);
+
+    inline size_t getBlockSize() const { return mBlockSize; }
+    // number of slab and oversized block allocations made from the heap so far
+    inline uint64_t getHeapAllocCount() const {
+        return mHeapAllocCount.load(std::memory_order_relaxed);
+    }
+};
+
+} // namespace loc_util
+
+#endif //__LOC_BLOCK_POOL_H__
@@ -0,0 +1,242 @@
+/* Copyright (c) 2021 The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation, nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef __LOC_MPSC_QUEUE_H__
+#define __LOC_MPSC_QUEUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <condition_variable>
+
+#ifndef LOC_CACHE_LINE_SIZE
+#define LOC_CACHE_LINE_SIZE 64
+#endif
+
+namespace loc_util {
+
+// A bounded multi-producer / single-consumer queue.
+//
+// Producers claim ring slots with a single CAS on the tail index and publish
+// them with a per-slot sequence number, so sendMsg() never takes a lock or
+// allocates while the ring has room. The consumer owns the head index and
+// only touches the mutex when it has nothing to do and must sleep.
+//
+// When constructed with *overflow* set, items that do not fit in the ring go
+// to a mutex protected std::deque instead of being rejected. Once anything
+// sits in the overflow, producers keep appending there until the consumer
+// has drained it, which preserves per-producer FIFO order.
+//
+// After unblock() is called, push() fails and pop() returns false; whatever
+// is left can still be retrieved with tryPop(), e.g. to free it.
+template <typename T>
+class LocMpscQueue {
+    struct Slot {
+        std::atomic<size_t> mSeq;
+        T mData;
+    };
+
+    // consumer side, only ever touched by the single consumer thread
+    size_t mHead;
+    char mPad0[LOC_CACHE_LINE_SIZE - sizeof(size_t)];
+    // producer side, contended by all producers
+    std::atomic<size_t> mTail;
+    char mPad1[LOC_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    // consumer is (about to be) blocked in pop()
+    std::atomic<bool> mWaiting;
+    std::atomic<bool> mUnblocked;
+    std::atomic<size_t> mOverflowSize;
+    char mPad2[LOC_CACHE_LINE_SIZE - 2 * sizeof(std::atomic<bool>) -
+               sizeof(std::atomic<size_t>)];
+
+    const size_t mMask;
+    const bool mOverflowEnabled;
+    Slot* mSlots;
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::deque<T> mOverflow;
+
+    static inline size_t roundUpPow2(size_t n) {
+        size_t v = 2;
+        while (v < n) {
+            v <<= 1;
+        }
+        return v;
+    }
+
+    template <typename U>
+    inline bool pushRing(U&& item) {
+        size_t pos = mTail.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &mSlots[pos & mMask];
+            size_t seq = slot->mSeq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (0 == dif) {
+                if (mTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                // ring is full
+                return false;
+            } else {
+                pos = mTail.load(std::memory_order_relaxed);
+            }
+        }
+        slot->mData = std::forward<U>(item);
+        slot->mSeq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    inline bool readable() const {
+        return mSlots[mHead & mMask].mSeq.load(std::memory_order_acquire) == mHead + 1 ||
+                mOverflowSize.load(std::memory_order_acquire) > 0;
+    }
+
+    inline void wakeConsumer() {
+        // pairs with the fence in pop(), so that either the consumer sees the
+        // new item before going to sleep, or we see it waiting here.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (mWaiting.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mCond.notify_one();
+        }
+    }
+
+public:
+    // *capacity* is rounded up to the next power of 2
+    inline LocMpscQueue(size_t capacity, bool overflow) :
+            mHead(0), mTail(0), mWaiting(false), mUnblocked(false), mOverflowSize(0),
+            mMask(roundUpPow2(capacity) - 1), mOverflowEnabled(overflow), mSlots(nullptr) {
+        void* mem = nullptr;
+        if (0 == posix_memalign(&mem, LOC_CACHE_LINE_SIZE, (mMask + 1) * sizeof(Slot))) {
+            mSlots = (Slot*)mem;
+            for (size_t i = 0; i <= mMask; i++) {
+                new (&mSlots[i]) Slot();
+                mSlots[i].mSeq.store(i, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    inline ~LocMpscQueue() {
+        if (nullptr != mSlots) {
+            for (size_t i = 0; i <= mMask; i++) {
+                mSlots[i].~Slot();
+            }
+            free(mSlots);
+        }
+    }
+
+    LocMpscQueue(const LocMpscQueue&) = delete;
+    LocMpscQueue& operator=(const LocMpscQueue&) = delete;
+
+    inline bool isValid() const { return nullptr != mSlots; }
+    inline size_t capacity() const { return mMask + 1; }
+    inline bool isUnblocked() const { return mUnblocked.load(std::memory_order_acquire); }
+
+    // Called from any thread. Returns false if the queue is unblocked, or if
+    // the ring is full and overflow is not enabled; *item* is left untouched
+    // in that case.
+    template <typename U>
+    bool push(U&& item) {
+        if (mUnblocked.load(std::memory_order_acquire)) {
+            return false;
+        }
+        if (0 == mOverflowSize.load(std::memory_order_acquire) &&
+                pushRing(std::forward<U>(item))) {
+            wakeConsumer();
+            return true;
+        }
+        if (!mOverflowEnabled) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        mOverflow.push_back(std::forward<U>(item));
+        mOverflowSize.fetch_add(1, std::memory_order_release);
+        if (mWaiting.load(std::memory_order_relaxed)) {
+            mCond.notify_one();
+        }
+        return true;
+    }
+
+    // Consumer thread only. Non-blocking; returns false if nothing is ready.
+    bool tryPop(T& item) {
+        Slot& slot = mSlots[mHead & mMask];
+        if (slot.mSeq.load(std::memory_order_acquire) == mHead + 1) {
+            item = std::move(slot.mData);
+            slot.mData = T();
+            slot.mSeq.store(mHead + mMask + 1, std::memory_order_release);
+            mHead++;
+            return true;
+        }
+        if (mOverflowSize.load(std::memory_order_acquire) > 0) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            item = std::move(mOverflow.front());
+            mOverflow.pop_front();
+            mOverflowSize.fetch_sub(1, std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+
+    // Consumer thread only. Blocks until an item is available; returns false
+    // once the queue is unblocked.
+    bool pop(T& item) {
+        for (;;) {
+            if (mUnblocked.load(std::memory_order_acquire)) {
+                return false;
+            }
+            if (tryPop(item)) {
+                return true;
+            }
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWaiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (!mUnblocked.load(std::memory_order_acquire) && !readable()) {
+                mCond.wait(lock);
+            }
+            mWaiting.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // Wakes up the consumer and stops the queue from accepting more items.
+    void unblock() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mUnblocked.store(true, std::memory_order_release);
+        mCond.notify_all();
+    }
+};
+
+} // namespace loc_util
+
+#endif //__LOC_MPSC_QUEUE_H__
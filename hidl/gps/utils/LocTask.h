@@ -0,0 +1,150 @@
+/* Copyright (c) 2021 The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name of The Linux Foundation, nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef __LOC_TASK_H__
+#define __LOC_TASK_H__
+
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+namespace loc_util {
+
+// A move-only void() callable with small buffer optimization. Callables up
+// to LOC_TASK_INLINE_SIZE bytes (which covers a std::function plus a few
+// captured pointers) are stored in place; only larger ones go to the heap.
+// Unlike std::function, a LocTask never copies its target.
+#define LOC_TASK_INLINE_SIZE 64
+
+class LocTask {
+    struct Ops {
+        void (*mInvoke)(void* storage);
+        void (*mMove)(void* dst, void* src);
+        void (*mDestroy)(void* storage);
+        bool mInlined;
+    };
+
+    template <typename F>
+    struct InlineOps {
+        static void invoke(void* storage) { (*(F*)storage)(); }
+        static void move(void* dst, void* src) {
+            new (dst) F(std::move(*(F*)src));
+            ((F*)src)->~F();
+        }
+        static void destroy(void* storage) { ((F*)storage)->~F(); }
+        static const Ops* ops() {
+            static const Ops sOps = { invoke, move, destroy, true };
+            return &sOps;
+        }
+    };
+
+    template <typename F>
+    struct HeapOps {
+        static void invoke(void* storage) { (**(F**)storage)(); }
+        static void move(void* dst, void* src) { *(F**)dst = *(F**)src; }
+        static void destroy(void* storage) { delete *(F**)storage; }
+        static const Ops* ops() {
+            static const Ops sOps = { invoke, move, destroy, false };
+            return &sOps;
+        }
+    };
+
+    template <typename F>
+    struct FitsInline {
+        typedef typename std::aligned_storage<LOC_TASK_INLINE_SIZE>::type Storage;
+        static const bool value = sizeof(F) <= sizeof(Storage) &&
+                std::alignment_of<F>::value <= std::alignment_of<Storage>::value &&
+                std::is_nothrow_move_constructible<F>::value;
+    };
+
+    template <typename F>
+    inline typename std::enable_if<FitsInline<F>::value>::type construct(F&& f) {
+        new (&mStorage) F(std::move(f));
+        mOps = InlineOps<F>::ops();
+    }
+
+    template <typename F>
+    inline typename std::enable_if<!FitsInline<F>::value>::type construct(F&& f) {
+        *(F**)&mStorage = new F(std::move(f));
+        mOps = HeapOps<F>::ops();
+    }
+
+    const Ops* mOps;
+    typename std::aligned_storage<LOC_TASK_INLINE_SIZE>::type mStorage;
+
+public:
+    inline LocTask() : mOps(nullptr) {}
+
+    template <typename F, typename = typename std::enable_if<
+            !std::is_same<typename std::decay<F>::type, LocTask>::value>::type>
+    inline LocTask(F&& f) : mOps(nullptr) {
+        typename std::decay<F>::type target(std::forward<F>(f));
+        construct(std::move(target));
+    }
+
+    inline LocTask(LocTask&& other) : mOps(other.mOps) {
+        if (nullptr != mOps) {
+            mOps->mMove(&mStorage, &other.mStorage);
+            other.mOps = nullptr;
+        }
+    }
+
+    inline LocTask& operator=(LocTask&& other) {
+        if (this != &other) {
+            reset();
+            mOps = other.mOps;
+            if (nullptr != mOps) {
+                mOps->mMove(&mStorage, &other.mStorage);
+                other.mOps = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    LocTask(const LocTask&) = delete;
+    LocTask& operator=(const LocTask&) = delete;
+
+    inline ~LocTask() { reset(); }
+
+    inline void reset() {
+        if (nullptr != mOps) {
+            mOps->mDestroy(&mStorage);
+            mOps = nullptr;
+        }
+    }
+
+    inline explicit operator bool() const { return nullptr != mOps; }
+    // false if the target did not fit in the inline buffer and was heap allocated
+    inline bool isInline() const { return nullptr == mOps || mOps->mInlined; }
+    inline void operator()() { if (nullptr != mOps) mOps->mInvoke(&mStorage); }
+};
+
+} // namespace loc_util
+
+#endif //__LOC_TASK_H__
@@ -30,18 +30,247 @@
 #define LOG_TAG "LocSvc_MsgTask"
 
 #include <unistd.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include <time.h>
+#include <inttypes.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
 #include <MsgTask.h>
-#include <msg_q.h>
+#include <LocMpscQueue.h>
+#include <LocBlockPool.h>
 #include <log_util.h>
 #include <loc_log.h>
 #include <loc_pla.h>
 
 namespace loc_util {
 
+// Number of messages the lock-free ring holds before sendMsg() spills into
+// the (mutex protected) overflow list.
+#define MSG_TASK_RING_CAPACITY 256
+// Max number of messages MTRunnable::run() drains and dispatches per wakeup.
+#define MSG_TASK_MAX_BATCH 64
+// Number of RunMsg blocks the pool grows by when it runs dry.
+#define MSG_TASK_RUN_MSG_SLAB_SIZE 32
+// Number of log2 buckets in a MsgTaskHistogram
+#define MSG_TASK_HIST_BUCKETS 24
+
+static inline uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct MsgQueueEntry {
+    LocMsg* mMsg;
+    LocMsgCoalesceKey mKey;
+    uint64_t mEnqueueNs;
+    inline MsgQueueEntry() : mMsg(nullptr), mKey(nullptr, 0), mEnqueueNs(0) {}
+    inline MsgQueueEntry(LocMsg* msg, const LocMsgCoalesceKey& key) :
+            mMsg(msg), mKey(key), mEnqueueNs(nowNs()) {}
+};
+
+// log2 histogram of durations in usec. Bucket 0 counts < 1 usec, bucket i
+// counts [2^(i-1), 2^i) usec, and the last bucket everything above.
+struct MsgTaskHistogram {
+    uint64_t mBuckets[MSG_TASK_HIST_BUCKETS];
+    uint64_t mCount;
+    uint64_t mTotalUs;
+    uint64_t mMaxUs;
+
+    inline MsgTaskHistogram() { reset(); }
+    inline void reset() { memset(this, 0, sizeof(*this)); }
+    inline void add(uint64_t ns) {
+        uint64_t us = ns / 1000;
+        int bucket = (0 == us) ? 0 : (64 - __builtin_clzll(us));
+        if (bucket >= MSG_TASK_HIST_BUCKETS) {
+            bucket = MSG_TASK_HIST_BUCKETS - 1;
+        }
+        mBuckets[bucket]++;
+        mCount++;
+        mTotalUs += us;
+        if (us > mMaxUs) {
+            mMaxUs = us;
+        }
+    }
+    void dump(const char* label, std::stringstream& ss) const {
+        ss << label << ": n=" << mCount
+           << " avg=" << (mCount > 0 ? mTotalUs / mCount : 0) << "us"
+           << " max=" << mMaxUs << "us [";
+        for (int i = 0; i < MSG_TASK_HIST_BUCKETS; i++) {
+            if (mBuckets[i] > 0) {
+                if (i == MSG_TASK_HIST_BUCKETS - 1) {
+                    ss << " >=" << (1ULL << (i - 1));
+                } else {
+                    ss << " <" << (1ULL << i);
+                }
+                ss << "us:" << mBuckets[i];
+            }
+        }
+        ss << " ]";
+    }
+};
+
+struct MsgTypeStats {
+    MsgTaskHistogram mWait;
+    MsgTaskHistogram mExec;
+};
+
+// Message types are told apart by their vtable pointer, as the HAL is built
+// without RTTI; the name is only resolved, through dladdr(), when dumping.
+static std::string getMsgTypeName(const void* vptr) {
+    char name[256];
+    Dl_info info = {};
+    if (0 == dladdr(vptr, &info) || nullptr == info.dli_fname) {
+        snprintf(name, sizeof(name), "LocMsg@%p", vptr);
+        return name;
+    }
+    // vptr points 2 words into the vtable, past offset-to-top and typeinfo.
+    // Anything else means the vtable is not exported and dladdr() matched
+    // some unrelated symbol, so give library + offset for offline symbolizing.
+    if (nullptr != info.dli_sname &&
+            (const char*)info.dli_saddr + 2 * sizeof(void*) == (const char*)vptr) {
+        int status = -1;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        std::string typeName((0 == status && nullptr != demangled) ?
+                demangled : info.dli_sname);
+        free(demangled);
+        return typeName;
+    }
+    const char* lib = strrchr(info.dli_fname, '/');
+    snprintf(name, sizeof(name), "%s+0x%" PRIxPTR, (nullptr != lib) ? lib + 1 : info.dli_fname,
+             (uintptr_t)vptr - (uintptr_t)info.dli_fbase);
+    return name;
+}
+
+// Wraps a posted callable; allocated from, and released back to, the
+// LocBlockPool of the MsgTask it is sent to.
+struct RunMsg : public LocMsg {
+    mutable LocTask mTask;
+    inline RunMsg(LocTask&& task) : LocMsg(), mTask(std::move(task)) {}
+    inline virtual void proc() const override { mTask(); }
+
+    // noexcept, so that a failed allocation yields nullptr instead of a throw
+    inline static void* operator new(size_t size, LocBlockPool& pool) noexcept {
+        return pool.alloc(size);
+    }
+    inline static void operator delete(void* block, LocBlockPool& /*pool*/) {
+        LocBlockPool::release(block);
+    }
+    inline static void operator delete(void* block) {
+        LocBlockPool::release(block);
+    }
+};
+
+// What MsgTask::mQ points to, owned by MTRunnable. Every live MsgQueue is
+// kept in sQueues, so that dumpStats() can walk all of them.
+struct MsgQueue : public LocMpscQueue<MsgQueueEntry> {
+    const std::string mName;
+    LocBlockPool mRunMsgPool;
+    std::atomic<uint64_t> mTaskHeapAllocCount;
+    std::atomic<uint32_t> mDepth;
+    std::atomic<uint32_t> mMaxDepth;
+
+    // written by the MsgTask thread, read by dumpStats()
+    std::mutex mStatsLock;
+    uint64_t mStatsSinceNs;
+    uint64_t mCoalesced;
+    MsgTypeStats mTotal;
+    std::unordered_map<const void*, MsgTypeStats> mTypeStats;
+
+    static std::mutex sQueuesLock;
+    static std::vector<MsgQueue*> sQueues;
+
+    inline MsgQueue(const char* name) :
+            LocMpscQueue<MsgQueueEntry>(MSG_TASK_RING_CAPACITY, true),
+            mName(nullptr != name ? name : "LocThread"),
+            mRunMsgPool(sizeof(RunMsg), MSG_TASK_RUN_MSG_SLAB_SIZE),
+            mTaskHeapAllocCount(0), mDepth(0), mMaxDepth(0),
+            mStatsSinceNs(nowNs()), mCoalesced(0) {
+        std::lock_guard<std::mutex> lock(sQueuesLock);
+        sQueues.push_back(this);
+    }
+    inline ~MsgQueue() {
+        std::lock_guard<std::mutex> lock(sQueuesLock);
+        for (auto it = sQueues.begin(); it != sQueues.end(); ++it) {
+            if (*it == this) {
+                sQueues.erase(it);
+                break;
+            }
+        }
+    }
+
+    inline void onPushed() {
+        uint32_t depth = mDepth.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint32_t maxDepth = mMaxDepth.load(std::memory_order_relaxed);
+        while (depth > maxDepth &&
+                !mMaxDepth.compare_exchange_weak(maxDepth, depth, std::memory_order_relaxed)) {
+        }
+    }
+    inline void onPopped() { mDepth.fetch_sub(1, std::memory_order_relaxed); }
+
+    void resetStats() {
+        std::lock_guard<std::mutex> lock(mStatsLock);
+        mStatsSinceNs = nowNs();
+        mCoalesced = 0;
+        mTotal = MsgTypeStats();
+        mTypeStats.clear();
+        mMaxDepth.store(mDepth.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    void dumpStats(std::function<void(std::stringstream&)>& log) {
+        std::lock_guard<std::mutex> lock(mStatsLock);
+        std::stringstream ss;
+        ss << "MsgTask " << mName << ": over " << (nowNs() - mStatsSinceNs) / 1000000
+           << "ms, depth=" << mDepth.load(std::memory_order_relaxed)
+           << " maxDepth=" << mMaxDepth.load(std::memory_order_relaxed)
+           << " coalesced=" << mCoalesced << std::endl;
+        log(ss);
+        ss.str("");
+        mTotal.mWait.dump("  all   wait", ss);
+        ss << std::endl;
+        log(ss);
+        ss.str("");
+        mTotal.mExec.dump("  all   exec", ss);
+        ss << std::endl;
+        log(ss);
+        for (auto& type : mTypeStats) {
+            ss.str("");
+            ss << "  " << getMsgTypeName(type.first) << std::endl;
+            type.second.mWait.dump("    wait", ss);
+            ss << std::endl;
+            type.second.mExec.dump("    exec", ss);
+            ss << std::endl;
+            log(ss);
+        }
+    }
+};
+
+std::mutex MsgQueue::sQueuesLock;
+std::vector<MsgQueue*> MsgQueue::sQueues;
+
+// timing of one dispatched message, folded into the MsgQueue stats per batch
+struct MsgDispatchTiming {
+    const void* mType;
+    uint64_t mWaitNs;
+    uint64_t mExecNs;
+};
+
 class MTRunnable : public LocRunnable {
-    const void* mQ;
+    MsgQueue* mQ;
+    std::vector<MsgQueueEntry> mBatch;
+    std::vector<LocMsgCoalesceKey> mSeenKeys;
+    std::vector<MsgDispatchTiming> mTimings;
+    uint32_t coalesceBatch();
+    void updateStats(uint32_t coalesced);
 public:
-    inline MTRunnable(const void* q) : mQ(q) {}
+    inline MTRunnable(MsgQueue* q) : mQ(q) {
+        mBatch.reserve(MSG_TASK_MAX_BATCH);
+        mSeenKeys.reserve(MSG_TASK_MAX_BATCH);
+        mTimings.reserve(MSG_TASK_MAX_BATCH);
+    }
     virtual ~MTRunnable();
     // Overrides of LocRunnable methods
     // This method will be repeated called until it returns false; or
@@ -56,18 +285,24 @@ public:
     virtual void interrupt() override;
 };
 
-static void LocMsgDestroy(void* msg) {
-    delete (LocMsg*)msg;
-}
-
 MsgTask::MsgTask(const char* threadName) :
-    mQ(msg_q_init2()), mThread() {
-    mThread.start(threadName, std::make_shared<MTRunnable>(mQ));
+    mQ(new MsgQueue(threadName)), mThread() {
+    mThread.start(threadName, std::make_shared<MTRunnable>((MsgQueue*)mQ));
 }
 
 void MsgTask::sendMsg(const LocMsg* msg) const {
+    sendMsg(msg, LocMsgCoalesceKey(nullptr, 0));
+}
+
+void MsgTask::sendMsg(const LocMsg* msg, const LocMsgCoalesceKey& key) const {
     if (msg) {
-        msg_q_snd((void*)mQ, (void*)msg, LocMsgDestroy);
+        MsgQueue* q = (MsgQueue*)mQ;
+        if (q->push(MsgQueueEntry((LocMsg*)msg, key))) {
+            q->onPushed();
+        } else {
+            LOC_LOGE("%s: msg queue is unblocked, dropping msg %p", __func__, msg);
+            delete msg;
+        }
     } else {
         LOC_LOGE("%s: msg is %p and this is %p",
                  __func__, msg, this);
@@ -75,18 +310,42 @@ void MsgTask::sendMsg(const LocMsg* msg) const {
 }
 
 void MsgTask::sendMsg(const std::function<void()> runnable) const {
-    struct RunMsg : public LocMsg {
-        const std::function<void()> mRunnable;
-    public:
-        inline RunMsg(const std::function<void()> runnable) : mRunnable(runnable) {}
-        ~RunMsg() = default;
-        inline virtual void proc() const override { mRunnable(); }
-    };
-    sendMsg(new RunMsg(runnable));
+    sendTask(LocTask(std::move(runnable)));
+}
+
+void MsgTask::sendTask(LocTask&& task) const {
+    MsgQueue* q = (MsgQueue*)mQ;
+    if (!task.isInline()) {
+        q->mTaskHeapAllocCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    sendMsg(new (q->mRunMsgPool) RunMsg(std::move(task)));
+}
+
+uint64_t MsgTask::getHeapAllocCount() const {
+    MsgQueue* q = (MsgQueue*)mQ;
+    return q->mRunMsgPool.getHeapAllocCount() +
+            q->mTaskHeapAllocCount.load(std::memory_order_relaxed);
+}
+
+void MsgTask::dumpStats(std::function<void(std::stringstream&)> log) {
+    if (nullptr == log) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(MsgQueue::sQueuesLock);
+    for (auto q : MsgQueue::sQueues) {
+        q->dumpStats(log);
+    }
+}
+
+void MsgTask::resetStats() {
+    std::lock_guard<std::mutex> lock(MsgQueue::sQueuesLock);
+    for (auto q : MsgQueue::sQueues) {
+        q->resetStats();
+    }
 }
 
 void MTRunnable::interrupt() {
-    msg_q_unblock((void*)mQ);
+    mQ->unblock();
 }
 
 void MTRunnable::prerun() {
@@ -94,27 +353,100 @@ void MTRunnable::prerun() {
      set_sched_policy(gettid(), SP_FOREGROUND);
 }
 
+// Walks the batch from the latest message backwards and drops every message
+// whose coalesce key was already seen, i.e. that is superseded by a later one.
+// Returns the number of messages dropped.
+uint32_t MTRunnable::coalesceBatch() {
+    uint32_t coalesced = 0;
+    mSeenKeys.clear();
+    for (auto it = mBatch.rbegin(); it != mBatch.rend(); ++it) {
+        if (nullptr == it->mKey.first) {
+            continue;
+        }
+        bool superseded = false;
+        for (auto& seen : mSeenKeys) {
+            if (seen == it->mKey) {
+                superseded = true;
+                break;
+            }
+        }
+        if (superseded) {
+            LOC_LOGV("%s: dropping superseded msg %p", __func__, it->mMsg);
+            delete it->mMsg;
+            it->mMsg = nullptr;
+            coalesced++;
+        } else {
+            mSeenKeys.push_back(it->mKey);
+        }
+    }
+    return coalesced;
+}
+
+void MTRunnable::updateStats(uint32_t coalesced) {
+    std::lock_guard<std::mutex> lock(mQ->mStatsLock);
+    mQ->mCoalesced += coalesced;
+    for (auto& t : mTimings) {
+        MsgTypeStats& stats = mQ->mTypeStats[t.mType];
+        stats.mWait.add(t.mWaitNs);
+        stats.mExec.add(t.mExecNs);
+        mQ->mTotal.mWait.add(t.mWaitNs);
+        mQ->mTotal.mExec.add(t.mExecNs);
+    }
+    mTimings.clear();
+}
+
 bool MTRunnable::run() {
-    LocMsg* msg;
-    msq_q_err_type result = msg_q_rcv((void*)mQ, (void **)&msg);
-    if (eMSG_Q_SUCCESS != result) {
-        LOC_LOGE("%s:%d] fail receiving msg: %s\n", __func__, __LINE__,
-                 loc_get_msg_q_status(result));
+    MsgQueueEntry entry;
+    if (!mQ->pop(entry)) {
+        LOC_LOGE("%s:%d] fail receiving msg: queue unblocked\n", __func__, __LINE__);
         return false;
     }
 
-    msg->log();
-    // there is where each individual msg handling is invoked
-    msg->proc();
+    // drain whatever else is already pending, so that a backlog is
+    // dispatched back-to-back without going through the wakeup path
+    mBatch.push_back(entry);
+    while (mBatch.size() < MSG_TASK_MAX_BATCH && mQ->tryPop(entry)) {
+        mBatch.push_back(entry);
+    }
+    for (size_t i = 0; i < mBatch.size(); i++) {
+        mQ->onPopped();
+    }
+
+    uint32_t coalesced = 0;
+    if (mBatch.size() > 1) {
+        coalesced = coalesceBatch();
+    }
+
+    uint64_t startNs = nowNs();
+    for (auto& e : mBatch) {
+        if (nullptr == e.mMsg) {
+            continue;
+        }
+        if (!mQ->isUnblocked()) {
+            e.mMsg->log();
+            // there is where each individual msg handling is invoked
+            e.mMsg->proc();
 
-    delete msg;
+            uint64_t endNs = nowNs();
+            MsgDispatchTiming timing = { *(const void* const*)e.mMsg,
+                    startNs - e.mEnqueueNs, endNs - startNs };
+            mTimings.push_back(timing);
+            startNs = endNs;
+        }
+        delete e.mMsg;
+    }
+    mBatch.clear();
+    updateStats(coalesced);
 
     return true;
 }
 
 MTRunnable::~MTRunnable() {
-    msg_q_flush((void*)mQ);
-    msg_q_destroy((void**)&mQ);
+    MsgQueueEntry entry;
+    while (mQ->tryPop(entry)) {
+        delete entry.mMsg;
+    }
+    delete mQ;
 }
 
 } // namespace loc_util
@@ -29,11 +29,20 @@
 #ifndef __MSG_TASK__
 #define __MSG_TASK__
 
+#include <stdint.h>
+#include <utility>
+#include <sstream>
 #include <functional>
+#include <type_traits>
 #include <LocThread.h>
+#include <LocTask.h>
 
 namespace loc_util {
 
+// Identifies a stream of messages that supersede each other, { owner, kind };
+// a null owner means the message is never coalesced.
+typedef std::pair<const void*, uint32_t> LocMsgCoalesceKey;
+
 struct LocMsg {
     inline LocMsg() {}
     inline virtual ~LocMsg() {}
@@ -48,7 +57,30 @@ public:
     ~MsgTask() = default;
     MsgTask(const char* threadName = NULL);
     void sendMsg(const LocMsg* msg) const;
+    // Messages carrying a full snapshot of some state (e.g. SV status) can be
+    // sent with a coalesce key. When the MsgTask thread falls behind and drains
+    // several pending messages with the same key in one batch, only the latest
+    // one gets proc()'d.
+    void sendMsg(const LocMsg* msg, const LocMsgCoalesceKey& key) const;
     void sendMsg(const std::function<void()> runnable) const;
+    // Posts a callable without wrapping it in a std::function first. Callables
+    // that fit in a LocTask inline buffer, and the message carrying them, come
+    // out of a per MsgTask pool, so this does not touch the heap in steady state.
+    template <typename F, typename = typename std::enable_if<
+            !std::is_convertible<F, const LocMsg*>::value>::type>
+    inline void sendMsg(F&& runnable) const {
+        sendTask(LocTask(std::forward<F>(runnable)));
+    }
+    void sendTask(LocTask&& task) const;
+    // Number of heap allocations made on behalf of posted callables so far;
+    // stops growing once the pool has reached the working set.
+    uint64_t getHeapAllocCount() const;
+
+    // Dumps, for every live MsgTask, the max queue depth and histograms of
+    // queue wait and handler execution time, overall and per message type.
+    static void dumpStats(std::function<void(std::stringstream&)> log);
+    // Restarts the statistics of every live MsgTask from now.
+    static void resetStats();
 };
 
 } //